@@ -0,0 +1,235 @@
+#include <stddef.h>
+#include "chip8.h"
+
+
+/*
+ * Creates a boot image holding the font sets
+ * The program is copied in next, then hashImage() seals it. The caller owns
+ * one reference.
+ */
+struct chip8_image *createImage(){
+  uint8_t fontset[80] = { 
+    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+    0x20, 0x60, 0x20, 0x20, 0x70, // 1
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+  };
+  uint8_t hires_fontset[100] = {
+    0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C, // 0
+    0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, // 1
+    0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF, // 2
+    0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C, // 3
+    0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C, // 5
+    0x3E, 0x7C, 0xC0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C, // 6
+    0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60, // 7
+    0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C, // 8
+    0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C  // 9
+  };
+
+  struct chip8_image *image = calloc(1, sizeof(struct chip8_image));
+
+  if (image == NULL)
+    return NULL;
+  atomic_init(&image->references, 1);
+
+  // load fontset into memory
+  for (int i = 0; i < 80; i++)
+    image->memory[i] = fontset[i];
+  for (int i = 0; i < 100; i++)
+    image->memory[HIRES_FONT + i] = hires_fontset[i];
+
+  return image;
+}
+
+
+/*
+ * Computes the memory hash of a loaded image, shared by every machine booted from it
+ */
+void hashImage(struct chip8_image *image){
+  uint64_t hash = 0;
+
+  for (int i = 0; i < MEMORY_SIZE; i++)
+    hash ^= hashKey(HASH_MEMORY, i, image->memory[i]);
+  image->memory_hash = hash;
+}
+
+
+/*
+ * Drops a reference to an image, freeing it with the last one
+ */
+void releaseImage(struct chip8_image *image){
+  if (atomic_fetch_sub(&image->references, 1) == 1)
+    free(image);
+}
+
+
+/*
+ * Finds the memory_page holding a page's bytes
+ */
+static struct memory_page *pageOf(uint8_t *memory){
+  return (struct memory_page *)(memory - offsetof(struct memory_page, memory));
+}
+
+
+/*
+ * Drops a reference to a copied page, freeing it with the last one
+ */
+static void releasePage(struct memory_page *page){
+  if (atomic_fetch_sub(&page->references, 1) == 1)
+    free(page);
+}
+
+
+/*
+ * Makes a page private before a write
+ * Pages from the image or shared with a clone are copied. A page whose
+ * clones have all let go of it is taken over without a copy.
+ */
+void copyPage(struct chip8 *cpu, int page){
+  struct memory_page *shared = NULL, *copy;
+
+  if (cpu->owned_pages & (1 << page)){
+    shared = pageOf(cpu->pages[page]);
+    if (atomic_load(&shared->references) == 1){
+      cpu->private_pages |= 1 << page;
+      return;
+    }
+  }
+
+  copy = malloc(sizeof(struct memory_page));
+  if (copy == NULL){
+    printf("ERROR: out of memory copying page %X\n", page);
+    exit(0);
+  }
+  atomic_init(&copy->references, 1);
+  memcpy(copy->memory, cpu->pages[page], MEMORY_PAGE_SIZE);
+  if (shared != NULL)
+    releasePage(shared);
+  cpu->pages[page] = copy->memory;
+  cpu->owned_pages |= 1 << page;
+  cpu->private_pages |= 1 << page;
+}
+
+
+/*
+ * Drops a machine's references to its copied pages and to the image
+ */
+void releaseMemory(struct chip8 *cpu){
+  for (int page = 0; page < MEMORY_PAGES; page++)
+    if (cpu->owned_pages & (1 << page))
+      releasePage(pageOf(cpu->pages[page]));
+  cpu->owned_pages = 0;
+  cpu->private_pages = 0;
+  if (cpu->image != NULL)
+    releaseImage(cpu->image);
+  cpu->image = NULL;
+}
+
+
+/*  
+ * Resets chip8
+ * Memory starts out as the shared pages of image. cpu must be new (zeroed)
+ * or released with releaseMemory(), booting over a running machine leaks
+ * its pages and image reference.
+ */
+void coldBoot(struct chip8 *cpu, struct chip8_image *image){
+  // reset chip
+  memset(cpu, 0, sizeof(struct chip8));
+  cpu->program_counter = 0x200;
+  cpu->delay_timer = 60;
+
+  // map memory onto the image
+  atomic_fetch_add(&image->references, 1);
+  cpu->image = image;
+  for (int page = 0; page < MEMORY_PAGES; page++)
+    cpu->pages[page] = &image->memory[page * MEMORY_PAGE_SIZE];
+
+  // registers, stack and screen are clear, only memory contributes
+  cpu->state_hash = image->memory_hash;
+
+  // set start time
+  gettimeofday(&cpu->clock_time, NULL);
+}
+
+
+/*
+ * Forks a machine into clone
+ * clone must be new or released, like for coldBoot(). It starts as an exact
+ * copy of cpu that shares all of its memory: both machines take a reference
+ * to each copied page and copy it again on their next write to it. The
+ * clone is not traced.
+ */
+void cloneMachine(struct chip8 *clone, struct chip8 *cpu){
+  *clone = *cpu;
+  clone->trace = NULL;
+
+  atomic_fetch_add(&cpu->image->references, 1);
+  for (int page = 0; page < MEMORY_PAGES; page++)
+    if (cpu->owned_pages & (1 << page))
+      atomic_fetch_add(&pageOf(cpu->pages[page])->references, 1);
+  cpu->private_pages = 0;
+  clone->private_pages = 0;
+}
+
+
+/*
+ * Returns the 64-bit hash identifying the whole machine state
+ * Memory, registers, stack and screen are maintained incrementally by
+ * emulateCycle; the scalars that change nearly every cycle are mixed in here
+ */
+uint64_t stateHash(struct chip8 *cpu){
+  return cpu->state_hash ^ cpu->graphics_hash ^
+    hashKey(HASH_PC, 0, cpu->program_counter) ^
+    hashKey(HASH_INDEX, 0, cpu->index) ^
+    hashKey(HASH_SP, 0, cpu->stack_pointer) ^
+    hashKey(HASH_DELAY, 0, cpu->delay_timer) ^
+    hashKey(HASH_SOUND, 0, cpu->sound_timer) ^
+    hashKey(HASH_HIRES, 0, cpu->hires);
+}
+
+
+/*
+ * Recomputes the screen hash, used after scrolling moves every row
+ */
+void rehashGraphics(struct chip8 *cpu){
+  uint64_t hash = 0;
+
+  for (int row = 0; row < GRAPHICS_HEIGHT; row++)
+    for (int word = 0; word < GRAPHICS_WORDS; word++)
+      hash ^= graphicsKey(row, word, cpu->graphics[row][word]);
+  cpu->graphics_hash = hash;
+}
+
+
+/*
+ * Recomputes the state hash from scratch
+ * Needed after state is changed outside emulateCycle
+ */
+void rehashState(struct chip8 *cpu){
+  uint64_t hash = 0;
+
+  for (int i = 0; i < MEMORY_SIZE; i++)
+    hash ^= hashKey(HASH_MEMORY, i, cpu->pages[i / MEMORY_PAGE_SIZE][i % MEMORY_PAGE_SIZE]);
+  for (int i = 0; i < 16; i++)
+    hash ^= hashKey(HASH_REGISTER, i, cpu->registers[i]);
+  for (int i = 0; i < cpu->stack_pointer; i++)
+    hash ^= hashKey(HASH_STACK, i, cpu->stack[i]);
+  for (int i = 0; i < 8; i++)
+    hash ^= hashKey(HASH_RPL, i, cpu->rpl[i]);
+  cpu->state_hash = hash;
+
+  rehashGraphics(cpu);
+}
@@ -1,34 +1,136 @@
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 #include <time.h>
+#include <sys/time.h>
+#include <stdatomic.h>
+#include "trace.h"
+#include "state_hash.h"
 
 typedef int bool;
 #define TRUE 1
 #define FALSE 0
 
+#define MEMORY_SIZE 4096
+#define MEMORY_PAGE_SIZE 256
+#define MEMORY_PAGES (MEMORY_SIZE / MEMORY_PAGE_SIZE)
+
+// SUPER-CHIP hi-res screen, lo-res uses the top left 64x32
+#define GRAPHICS_WIDTH 128
+#define GRAPHICS_HEIGHT 64
+#define GRAPHICS_WORDS (GRAPHICS_WIDTH / 64)
+#define LORES_WIDTH 64
+#define LORES_HEIGHT 32
+#define HIRES_FONT 0x50 // 8x10 digits for FX30, after the 4x5 font
+
+// Boot memory (font set and program) shared read-only by every machine
+// running the same program. Machines copy a page out only when they first
+// write to it.
+struct chip8_image {
+  uint8_t memory[MEMORY_SIZE];
+  uint64_t memory_hash; // Zobrist hash of memory, set by hashImage()
+  atomic_int references;
+};
+
+// Page copied out of an image, shared copy on write between clones
+struct memory_page {
+  atomic_int references;
+  uint8_t memory[MEMORY_PAGE_SIZE];
+};
+
 struct chip8 {
+  // hot state used by every instruction
   uint16_t opcode; 
-  uint8_t memory[4096]; // 4K memory
-  uint8_t registers[16]; // 16 registers
   uint16_t index;
   uint16_t program_counter;
+  uint16_t stack_pointer;
+  uint8_t registers[16]; // 16 registers
+  uint16_t stack[16];
 
+  // register timers at 60Hz (aka 60 instructions per second)
+  uint8_t delay_timer;
+  uint8_t sound_timer;
+  bool draw_flag;
+  bool hires; // 128x64 SUPER-CHIP mode
+  bool halted; // stopped by 00FD or an unknown opcode, must not be run further
+
+  // 4K memory in pages, shared from image until written, then from a memory_page
   // 0x000-0x1FF - Chip 8 interpreter (contains font set in emu)
   // 0-x050-0x0A0 - Used for the built in 4x5 pixel font set (0-F)
   // 0x200-0xFFF - Program ROM and work RAM
+  uint8_t *pages[MEMORY_PAGES];
+  uint16_t owned_pages;   // bit per page held in a memory_page
+  uint16_t private_pages; // bit per owned page no clone shares, writable in place
+  struct chip8_image *image;
 
-  uint8_t graphics[64 * 32]; // 2048 pixels - 64x32
-  bool draw_flag;
+  // incremental Zobrist hash of memory, registers and stack, and of the screen
+  // stateHash() adds the remaining scalars, see state_hash.h
+  uint64_t state_hash;
+  uint64_t graphics_hash;
 
-  // register timers at 60Hz (aka 60 instructions per second)
-  uint8_t delay_timer;
-  uint8_t sound_timer;
-  struct timeval clock_time;
+  // one bit per pixel, leftmost pixel in the top bit of word 0
+  uint64_t graphics[GRAPHICS_HEIGHT][GRAPHICS_WORDS];
 
-  uint16_t stack[16];
-  uint16_t stack_pointer;
+  // SUPER-CHIP RPL user flags (FX75/FX85)
+  uint8_t rpl[8];
 
   // HEX based keypad
   uint8_t key[16];
 
-} chip8;
\ No newline at end of file
+  struct timeval clock_time;
+
+  // instruction trace, NULL when tracing is off
+  struct trace *trace;
+
+};
+
+struct chip8_image *createImage();
+void hashImage(struct chip8_image *image);
+void releaseImage(struct chip8_image *image);
+void copyPage(struct chip8 *cpu, int page);
+void releaseMemory(struct chip8 *cpu);
+void coldBoot(struct chip8 *cpu, struct chip8_image *image);
+void cloneMachine(struct chip8 *clone, struct chip8 *cpu);
+uint64_t stateHash(struct chip8 *cpu);
+void rehashGraphics(struct chip8 *cpu);
+void rehashState(struct chip8 *cpu);
+
+
+/*
+ * Reads a byte of memory, addresses wrap at 4K
+ */
+static inline uint8_t readMemory(struct chip8 *cpu, uint16_t address){
+  address &= MEMORY_SIZE - 1;
+  return cpu->pages[address / MEMORY_PAGE_SIZE][address % MEMORY_PAGE_SIZE];
+}
+
+
+/*
+ * Stores a byte in memory and keeps the state hash current
+ * The first write that changes a shared page copies it, see copyPage()
+ */
+static inline void writeMemory(struct chip8 *cpu, uint16_t address, uint8_t value){
+  int page;
+  uint8_t old;
+
+  address &= MEMORY_SIZE - 1;
+  page = address / MEMORY_PAGE_SIZE;
+  old = cpu->pages[page][address % MEMORY_PAGE_SIZE];
+  if (old == value)
+    return;
+  if ((cpu->private_pages & (1 << page)) == 0)
+    copyPage(cpu, page);
+  cpu->state_hash ^= hashKey(HASH_MEMORY, address, old) ^ hashKey(HASH_MEMORY, address, value);
+  cpu->pages[page][address % MEMORY_PAGE_SIZE] = value;
+}
+
+
+/*
+ * Zobrist key of one framebuffer word, hashed as two 32-bit halves
+ */
+static inline uint64_t graphicsKey(int row, int word, uint64_t bits){
+  int slot = (row * GRAPHICS_WORDS + word) * 2;
+
+  return hashKey(HASH_GRAPHICS, slot, (uint32_t)bits) ^ hashKey(HASH_GRAPHICS, slot + 1, bits >> 32);
+}
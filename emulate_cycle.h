@@ -0,0 +1,398 @@
+/*
+ * Instruction cycle template
+ *
+ * Included once per quirk profile from game_loop.c. Before each include define:
+ *   EMULATE_CYCLE      name of the generated function
+ *   QUIRK_SHIFT_VY     8XY6/8XYE shift VY into VX instead of shifting VX in place
+ *   QUIRK_LOAD_STORE   FX55/FX65 index change: 0 = unchanged, 1 = I += X + 1, 2 = I += X
+ *   QUIRK_CLIP         DXYN clips sprites at the screen edge instead of wrapping
+ *   QUIRK_INDEX_VF     FX1E sets VF on index overflow past 0xFFF
+ *   QUIRK_JUMP_VX      BNNN is treated as BXNN and jumps to XNN + VX
+ *   QUIRK_LOGIC_VF     8XY1/8XY2/8XY3 reset VF to 0
+ *   QUIRK_SCHIP        SUPER-CHIP opcodes: 128x64 mode, 16x16 sprites, scrolling, FX30/FX75/FX85
+ *
+ * Every quirk is resolved by the preprocessor so the generated interpreters
+ * carry no runtime quirk checks. All macros are undefined again at the end.
+ */
+
+void EMULATE_CYCLE(struct chip8 *cpu){
+  int dont_increment = 0;
+  bool key_press = FALSE;
+  uint8_t x, y, n, pixel;
+  int width, height, sprite_width, overflow;
+  uint32_t line;
+  uint64_t mask[GRAPHICS_WORDS];
+  uint8_t before[16];
+  uint16_t program_counter = cpu->program_counter;
+  uint8_t collision = 0;
+  uint16_t mem_write = TRACE_NO_WRITE;
+  uint16_t opcode = (readMemory(cpu, cpu->program_counter) << 8 | 
+    readMemory(cpu, cpu->program_counter + 1)); // fetch opcode
+  cpu->opcode = opcode;
+  memcpy(before, cpu->registers, 16);
+
+  if (debug_enabled){
+    printf("Opcode: %04X\n", cpu->opcode);
+    dumpDebug(cpu);
+    printf("Press any key to continue");
+    getchar();
+  }
+
+  switch (opcode & 0xF000){ // Decode opcode
+    // Execute opcode
+    case 0x0000:
+#if QUIRK_SCHIP
+      if ((opcode & 0xFFF0) == 0x00C0){ // 00CN: scrolls the screen down N rows
+        scrollDown(cpu, opcode & 0x000F);
+        break;
+      }
+#endif
+      switch(opcode){
+        case 0x00E0: // 00E0: clear screen
+          clearScreen(cpu);
+          break;
+        case 0x00EE: // 00EE: returns from subroutine
+          cpu->stack_pointer--;
+          cpu->program_counter = cpu->stack[cpu->stack_pointer];
+          cpu->state_hash ^= hashKey(HASH_STACK, cpu->stack_pointer, cpu->program_counter);
+          break;
+#if QUIRK_SCHIP
+        case 0x00FB: // 00FB: scrolls the screen right 4 pixels
+          scrollHorizontal(cpu, 1);
+          break;
+        case 0x00FC: // 00FC: scrolls the screen left 4 pixels
+          scrollHorizontal(cpu, 0);
+          break;
+        case 0x00FD: // 00FD: exits the interpreter
+          haltMachine(cpu, program_counter);
+          return;
+        case 0x00FE: // 00FE: switches to 64x32 lo-res, clearing the screen
+        case 0x00FF: // 00FF: switches to 128x64 hi-res, clearing the screen
+          cpu->hires = opcode == 0x00FF;
+          clearScreen(cpu);
+          break;
+#endif
+        default:
+          printf("Opcode not recognized: %04X\n", opcode);
+          dumpDebug(cpu);
+          haltMachine(cpu, program_counter);
+          return;
+      }
+      break;
+    case 0x1000: // 1NNN: jumps to address NNN
+      cpu->program_counter = (opcode & 0x0FFF);
+      dont_increment = 1;
+      break;
+    case 0x2000: // 2NNN: calls subroutine at address NNN
+      cpu->stack[cpu->stack_pointer] = cpu->program_counter;
+      cpu->state_hash ^= hashKey(HASH_STACK, cpu->stack_pointer, cpu->program_counter);
+      cpu->stack_pointer++;
+      cpu->program_counter = (opcode & 0x0FFF);
+      dont_increment = 1;
+      break;
+    case 0x3000: // 3XNN: skips next instruction if VX == NN
+      if (cpu->registers[(opcode & 0x0F00) >> 8] == (opcode & 0x00FF))
+        cpu->program_counter += 2;
+      break;
+    case 0x4000: // 4XNN: skips next instruction if VX != NN
+      if (cpu->registers[(opcode & 0x0F00) >> 8] != (opcode & 0x00FF))
+        cpu->program_counter += 2;
+      break;
+    case 0x5000: // 5XY0: skips next instruction if VX == VY
+      if (cpu->registers[(opcode & 0x0F00) >> 8] == cpu->registers[(opcode & 0x00F0) >> 4])
+        cpu->program_counter += 2;
+      break;
+    case 0x6000: // 6XNN: sets VX to NN
+      cpu->registers[(opcode & 0x0F00) >> 8] = opcode & 0x00FF;
+      break;
+    case 0x7000: // 7XNN: Adds NN to VX
+      cpu->registers[(opcode & 0x0F00) >> 8] += opcode & 0x00FF;
+      break;
+    case 0x8000: // 8NNN: 
+      switch (opcode & 0x000F){
+        case 0x0000: // 8XY0: sets VX to VY
+          cpu->registers[(opcode & 0x0F00) >> 8] = cpu->registers[(opcode & 0x00F0) >> 4];
+          break;
+        case 0x0001: // 8XY1: sets VX to VX | VY
+          cpu->registers[(opcode & 0x0F00) >> 8] |= cpu->registers[(opcode & 0x00F0) >> 4];
+#if QUIRK_LOGIC_VF
+          cpu->registers[0xF] = 0;
+#endif
+          break;
+        case 0x0002: // 8XY2: sets VX to VX & VY
+          cpu->registers[(opcode & 0x0F00) >> 8] &= cpu->registers[(opcode & 0x00F0) >> 4];
+#if QUIRK_LOGIC_VF
+          cpu->registers[0xF] = 0;
+#endif
+          break;
+        case 0x0003: // 8XY3: sets VX to VX ^ VY
+          cpu->registers[(opcode & 0x0F00) >> 8] ^= cpu->registers[(opcode & 0x00F0) >> 4];
+#if QUIRK_LOGIC_VF
+          cpu->registers[0xF] = 0;
+#endif
+          break;
+        case 0x0004: // 8XY4: adds VY to VX
+                     // VF is set to 1 when there's a carry, and to 0 when there isn't
+          if (cpu->registers[(opcode & 0x00F0) >> 4] > (0xFF - cpu->registers[(opcode & 0x0F00) >> 8]))
+            cpu->registers[0xF] = 1;
+          else
+            cpu->registers[0xF] = 0;
+          cpu->registers[(opcode & 0x0F00) >> 8] += cpu->registers[(opcode & 0x00F0) >> 4];
+          break;
+        case 0x0005: // 8XY5: subtracts VY from VX 
+                     // VF is set to 0 when there's a borrow, and 1 when there isn't.
+          if (cpu->registers[(opcode & 0x00F0) >> 4] > cpu->registers[(opcode & 0x0F00) >> 8])
+            cpu->registers[0xF] = 0;
+          else
+            cpu->registers[0xF] = 1;
+          cpu->registers[(opcode & 0x0F00) >> 8] -= cpu->registers[(opcode & 0x00F0) >> 4];
+          break;
+        case 0x0006: // 8XY6: VX >> 1 (VX = VY >> 1 with QUIRK_SHIFT_VY)
+                     // VF is set to the value of the least significant bit of the source before the shift
+#if QUIRK_SHIFT_VY
+          pixel = cpu->registers[(opcode & 0x00F0) >> 4];
+#else
+          pixel = cpu->registers[(opcode & 0x0F00) >> 8];
+#endif
+          cpu->registers[(opcode & 0x0F00) >> 8] = pixel >> 1;
+          cpu->registers[0xF] = pixel & 0x1;
+          break;
+        case 0x0007: // 8XY7: Sets VX to VY minus VX
+                     // VF is set to 0 when there's a borrow, and 1 when there isn't
+          if (cpu->registers[(opcode & 0x00F0) >> 4] < cpu->registers[(opcode & 0x0F00) >> 8])
+            cpu->registers[0xF] = 0;
+          else
+            cpu->registers[0xF] = 1;
+          cpu->registers[(opcode & 0x0F00) >> 8] = cpu->registers[(opcode & 0x00F0) >> 4] - 
+            cpu->registers[(opcode & 0x0F00) >> 8];
+          break; 
+        case 0x000E: // 8XYE: VX << 1 (VX = VY << 1 with QUIRK_SHIFT_VY)
+                     // VF is set to the value of the most significant bit of the source before the shift
+#if QUIRK_SHIFT_VY
+          pixel = cpu->registers[(opcode & 0x00F0) >> 4];
+#else
+          pixel = cpu->registers[(opcode & 0x0F00) >> 8];
+#endif
+          cpu->registers[(opcode & 0x0F00) >> 8] = pixel << 1;
+          cpu->registers[0xF] = pixel >> 7;
+          break;
+        default:
+          printf("Opcode not recognized: %04X\n", opcode);
+          dumpDebug(cpu);
+          haltMachine(cpu, program_counter);
+          return;
+      }
+      break;
+    case 0x9000: // 9XY0: skips next instruction if VX != VY
+      if (cpu->registers[(opcode & 0x0F00) >> 8] != cpu->registers[(opcode & 0x00F0) >> 4])
+        cpu->program_counter += 2;
+      break;
+    case 0xA000: // ANNN: sets I to the address NNN
+      cpu->index = opcode & 0x0FFF;
+      break;
+    case 0xB000: // BNNN: jumps to address NNN plus V0 (BXNN: XNN plus VX with QUIRK_JUMP_VX)
+#if QUIRK_JUMP_VX
+      cpu->program_counter = (opcode & 0x0FFF) + cpu->registers[(opcode & 0x0F00) >> 8];
+#else
+      cpu->program_counter = (opcode & 0x0FFF) + cpu->registers[0];
+#endif
+      dont_increment = 1;
+      break;
+    case 0xC000: // CXNN: VX = rand() & NN
+      cpu->registers[(opcode & 0x0F00) >> 8] = (rand() % 0xFF) & (opcode & 0x00FF);
+      break;
+    case 0xD000: // DXYN: Draws a sprite at coordinate (VX, VY) that has a width of 8 pixels and a 
+                 // height of N pixels. Each row of 8 pixels is read as bit-coded starting from memory 
+                 // location I; I value doesn’t change after the execution of this instruction. As 
+                 // described above, VF is set to 1 if any screen pixels are flipped from set to unset 
+                 // when the sprite is drawn, and to 0 if that doesn’t happen.
+                 // The origin always wraps; pixels past the edge are clipped with
+                 // QUIRK_CLIP and wrap around otherwise. With QUIRK_SCHIP, DXY0 draws
+                 // a 16x16 sprite from 32 bytes, two per row.
+                 // Each sprite row becomes a mask over the 128-bit screen row and is
+                 // XORed in a word at a time.
+      width = screenWidth(cpu);
+      height = screenHeight(cpu);
+      x = cpu->registers[(opcode & 0x0F00) >> 8] % width;
+      y = cpu->registers[(opcode & 0x00F0) >> 4] % height;
+      n = opcode & 0x000F;
+      sprite_width = 8;
+#if QUIRK_SCHIP
+      if (n == 0){
+        n = 16;
+        sprite_width = 16;
+      }
+#endif
+      overflow = x + sprite_width - width; // pixels past the right edge
+      for (int row = 0; row < n; row++){
+        int screen_row = y + row;
+        if (screen_row >= height){
+#if QUIRK_CLIP
+          break;
+#else
+          screen_row -= height;
+#endif
+        }
+        if (sprite_width == 16)
+          line = (readMemory(cpu, cpu->index + row * 2) << 8) | readMemory(cpu, cpu->index + row * 2 + 1);
+        else
+          line = readMemory(cpu, cpu->index + row);
+
+        mask[0] = mask[1] = 0;
+        if (overflow > 0){
+          rowMask(line >> overflow, GRAPHICS_WIDTH - width, mask);
+#if !QUIRK_CLIP
+          rowMask(line & ((1 << overflow) - 1), GRAPHICS_WIDTH - overflow, mask);
+#endif
+        } else {
+          rowMask(line, GRAPHICS_WIDTH - x - sprite_width, mask);
+        }
+        collision |= drawWord(cpu, screen_row, 0, mask[0]);
+        collision |= drawWord(cpu, screen_row, 1, mask[1]);
+      }
+      cpu->registers[0xF] = collision;
+      cpu->draw_flag = TRUE;
+      break;
+    case 0xE000: // ENNN: 
+      switch (opcode & 0x00FF){
+        case 0x009E: // EX9E: skips the next instruction if the key stored in VX is pressed
+          if (cpu->key[cpu->registers[(opcode & 0x0F00) >> 8]] != 0)
+            cpu->program_counter += 2;
+          break;
+        case 0x00A1: // EXA1: Skips the next instruction if the key stored in VX isn't pressed
+          if (cpu->key[cpu->registers[(opcode & 0x0F00) >> 8]] == 0)
+            cpu->program_counter += 2;
+          break;
+        default:
+          printf("Opcode not recognized: %04X\n", opcode);
+          dumpDebug(cpu);
+          haltMachine(cpu, program_counter);
+          return;
+      }
+      break;
+    case 0xF000: // FNNN: 
+      switch (opcode & 0x00FF){
+        case 0x0007: // FX07: sets VX to the value of the delay timer
+          cpu->registers[(opcode & 0x0F00) >> 8] = cpu->delay_timer;
+          break;
+        case 0x000A: // FX0A: Wait for key, then store in VX
+          for (int i = 0; i < 16; i++){
+            if (cpu->key[i] != 0){
+              cpu->registers[(opcode & 0x0F00) >> 8] = cpu->index;
+              key_press = TRUE;
+            }
+            if (key_press == FALSE)
+              return;
+          }
+          break;
+        case 0x0015: // FX15: sets delay timer to VX
+          cpu->delay_timer = cpu->registers[(opcode & 0x0F00) >> 8];
+          break;
+        case 0x0018: // FX18: sets sound time to VX
+          cpu->sound_timer = cpu->registers[(opcode & 0x0F00) >> 8];
+          break;
+        case 0x001E: // FX1E: adds VX to index register
+                     // VF is set to 1 when range overflow (I+VX>0xFFF), otherwise 0 (QUIRK_INDEX_VF)
+#if QUIRK_INDEX_VF
+          if ((cpu->index + cpu->registers[(opcode & 0x0F00) >> 8]) > 0xFFF)
+            cpu->registers[0xF] = 1;
+          else
+            cpu->registers[0xF] = 0;
+#endif
+          cpu->index += cpu->registers[(opcode & 0x0F00) >> 8];
+          break;
+        case 0x0029: // FX29: sets index register to the location of the sprite for the character in 
+                     // VX. Characters 0-F (in hexadecimal) are represented by a 4x5 font
+          cpu->index = cpu->registers[(opcode & 0x0F00) >> 8] * 5;
+          break;
+#if QUIRK_SCHIP
+        case 0x0030: // FX30: sets index register to the 8x10 hi-res sprite for the digit in VX
+          cpu->index = HIRES_FONT + (cpu->registers[(opcode & 0x0F00) >> 8] % 10) * 10;
+          break;
+        case 0x0075: // FX75: stores V0 to VX (X <= 7) in the RPL user flags
+          for (int i = 0; i <= ((opcode & 0x0F00) >> 8) && i < 8; i++){
+            cpu->state_hash ^= hashKey(HASH_RPL, i, cpu->rpl[i]) ^ hashKey(HASH_RPL, i, cpu->registers[i]);
+            cpu->rpl[i] = cpu->registers[i];
+          }
+          break;
+        case 0x0085: // FX85: fills V0 to VX (X <= 7) from the RPL user flags
+          for (int i = 0; i <= ((opcode & 0x0F00) >> 8) && i < 8; i++)
+            cpu->registers[i] = cpu->rpl[i];
+          break;
+#endif
+        case 0x0033: // FX33: stores the binary-coded decimal representation of VX, with the most 
+                     // significant of three digits at the address in index register, the middle digit 
+                     // at index register plus 1, and the least significant digit at index register 
+                     // plus 2.
+          mem_write = cpu->index;
+          writeMemory(cpu, cpu->index,      cpu->registers[(opcode & 0x0F00) >> 8] / 100);
+          writeMemory(cpu, cpu->index + 1, (cpu->registers[(opcode & 0x0F00) >> 8] / 10) % 10);
+          writeMemory(cpu, cpu->index + 2, (cpu->registers[(opcode & 0x0F00) >> 8] % 100) % 10);
+          break;
+        case 0x0055: // FX55: stores V0 to VX (including VX) in memory starting at address in index register
+          mem_write = cpu->index;
+          for (int i = 0; i <= ((opcode & 0x0F00) >> 8); i++)
+            writeMemory(cpu, cpu->index + i, cpu->registers[i]);
+#if QUIRK_LOAD_STORE == 1
+          cpu->index += ((opcode & 0x0F00) >> 8) + 1;
+#elif QUIRK_LOAD_STORE == 2
+          cpu->index += (opcode & 0x0F00) >> 8;
+#endif
+          break;
+        case 0x0065: // FX65: fills V0 to VX (including VX) with values from memory starting at 
+                     // address in index register
+          for (int i = 0; i <= ((opcode & 0x0F00) >> 8); i++)
+            cpu->registers[i] = readMemory(cpu, cpu->index + i);
+#if QUIRK_LOAD_STORE == 1
+          cpu->index += ((opcode & 0x0F00) >> 8) + 1;
+#elif QUIRK_LOAD_STORE == 2
+          cpu->index += (opcode & 0x0F00) >> 8;
+#endif
+          break; 
+        default:
+          printf("Opcode not recognized: %04X\n", opcode);
+          dumpDebug(cpu);
+          haltMachine(cpu, program_counter);
+          return;
+      }
+      break;
+    default:
+      printf("Opcode not recognized: %04X\n", opcode);
+      dumpDebug(cpu);
+      haltMachine(cpu, program_counter);
+      return;
+  }
+
+  if (!dont_increment)
+    cpu->program_counter += 2;
+
+  if (cpu->trace)
+    traceInstruction(cpu->trace, program_counter, opcode, cpu->registers, cpu->index, mem_write);
+
+  // fold the changed registers into the state hash
+  if (memcmp(before, cpu->registers, 16) != 0){
+    for (int i = 0; i < 16; i++)
+      if (before[i] != cpu->registers[i])
+        cpu->state_hash ^= hashKey(HASH_REGISTER, i, before[i]) ^ hashKey(HASH_REGISTER, i, cpu->registers[i]);
+  }
+
+  //updateTimers(cpu);
+  if(cpu->delay_timer > 0)
+    cpu->delay_timer--;
+
+  if(cpu->sound_timer > 0)
+  {
+    if(cpu->sound_timer == 1)
+      printf("BEEP!\n");
+    cpu->sound_timer--;
+  }
+}
+
+#undef EMULATE_CYCLE
+#undef QUIRK_SHIFT_VY
+#undef QUIRK_LOAD_STORE
+#undef QUIRK_CLIP
+#undef QUIRK_INDEX_VF
+#undef QUIRK_JUMP_VX
+#undef QUIRK_LOGIC_VF
+#undef QUIRK_SCHIP
@@ -9,16 +9,21 @@
 #include <GLUT/glut.h>
 #include "chip8.h"
 
-#define SCREEN_WIDTH 64
-#define SCREEN_HEIGHT 32
+#define SCREEN_WIDTH GRAPHICS_WIDTH // texture size, lo-res draws into the top left quarter
+#define SCREEN_HEIGHT GRAPHICS_HEIGHT
 #define DRAWWITHTEXTURE
-#define MODIFIER 10
+#define MODIFIER 5
+#define BENCH_RUNS 10 // headless benchmark keeps the fastest run
+#define SEARCH_CYCLES 16 // instructions run after each input choice while exploring
+#define SEARCH_WIDTH 65536 // most machines kept per exploration level
+#define SEARCH_TABLE_LOG2 22 // transposition table slots while exploring
 
 int debug_enabled = 0; // debug mode flag
 int display_width = SCREEN_WIDTH * MODIFIER;
 int display_height = SCREEN_HEIGHT * MODIFIER;
 uint8_t screenData[SCREEN_HEIGHT][SCREEN_WIDTH][3]; 
 struct chip8 *c8;
+struct trace *exit_trace; // flushed by closeTrace however the program exits
 
 
 /*
@@ -29,6 +34,119 @@ void dumpDebug(struct chip8 *cpu){
     printf("register %d: %02X\n", i, cpu->registers[i]);
   printf("program_counter: %04X\n", cpu->program_counter);
   printf("index: %04X\n", cpu->index);
+  printf("state hash: %016llX\n", (unsigned long long)stateHash(cpu));
+}
+
+
+/*
+ * Stops the machine from inside an instruction
+ * The instruction fetched from program_counter is traced, so a trace ends
+ * with the instruction that stopped the machine. The caller returns from
+ * emulateCycle right away and whoever runs the machine checks halted.
+ */
+void haltMachine(struct chip8 *cpu, uint16_t program_counter){
+  cpu->halted = TRUE;
+  if (cpu->trace)
+    traceInstruction(cpu->trace, program_counter, cpu->opcode, cpu->registers, cpu->index, TRACE_NO_WRITE);
+}
+
+
+/*
+ * Active screen size, 128x64 in hi-res and 64x32 otherwise
+ */
+static inline int screenWidth(struct chip8 *cpu){
+  return cpu->hires ? GRAPHICS_WIDTH : LORES_WIDTH;
+}
+
+static inline int screenHeight(struct chip8 *cpu){
+  return cpu->hires ? GRAPHICS_HEIGHT : LORES_HEIGHT;
+}
+
+
+/*
+ * Returns 1 when the pixel at (x, y) is set
+ */
+static inline int pixelAt(struct chip8 *cpu, int x, int y){
+  return (cpu->graphics[y][x / 64] >> (63 - x % 64)) & 1;
+}
+
+
+/*
+ * XORs a sprite mask into one framebuffer word
+ * Returns 1 when a set pixel was flipped off (collision)
+ */
+static inline int drawWord(struct chip8 *cpu, int row, int word, uint64_t bits){
+  uint64_t old = cpu->graphics[row][word];
+
+  if (bits == 0)
+    return 0;
+  cpu->graphics[row][word] = old ^ bits;
+  cpu->graphics_hash ^= graphicsKey(row, word, old) ^ graphicsKey(row, word, old ^ bits);
+  return (old & bits) != 0;
+}
+
+
+/*
+ * Turns bits shifted left by shift into the two words of a 128 pixel row
+ * bits must fit in the row after the shift
+ */
+static inline void rowMask(uint32_t bits, int shift, uint64_t *mask){
+  if (shift >= 64){
+    mask[0] |= (uint64_t)bits << (shift - 64);
+  } else {
+    mask[1] |= (uint64_t)bits << shift;
+    if (shift > 0)
+      mask[0] |= (uint64_t)bits >> (64 - shift);
+  }
+}
+
+
+/*
+ * Clears the screen and its hash
+ */
+static inline void clearScreen(struct chip8 *cpu){
+  memset(cpu->graphics, 0, sizeof(cpu->graphics));
+  cpu->graphics_hash = 0;
+  cpu->draw_flag = TRUE;
+}
+
+
+/*
+ * SUPER-CHIP 00CN: scrolls the active screen down by n rows
+ * Whole rows move with one memmove
+ */
+void scrollDown(struct chip8 *cpu, int n){
+  int height = screenHeight(cpu);
+
+  if (n > height)
+    n = height;
+  memmove(cpu->graphics[n], cpu->graphics[0], (height - n) * sizeof(cpu->graphics[0]));
+  memset(cpu->graphics[0], 0, n * sizeof(cpu->graphics[0]));
+  rehashGraphics(cpu);
+  cpu->draw_flag = TRUE;
+}
+
+
+/*
+ * SUPER-CHIP 00FB/00FC: scrolls the active screen 4 pixels right or left
+ * Each row is shifted as a 128-bit word pair, lo-res rows only use word 0
+ */
+void scrollHorizontal(struct chip8 *cpu, int right){
+  int height = screenHeight(cpu);
+
+  for (int row = 0; row < height; row++){
+    uint64_t *line = cpu->graphics[row];
+    if (right){
+      if (cpu->hires)
+        line[1] = (line[1] >> 4) | (line[0] << 60);
+      line[0] >>= 4;
+    } else { // word 1 stays clear in lo-res
+      line[0] = (line[0] << 4) | (line[1] >> 60);
+      line[1] <<= 4;
+    }
+  }
+  rehashGraphics(cpu);
+  cpu->draw_flag = TRUE;
 }
 
 
@@ -144,8 +262,10 @@ void setupTexture(){
     for(x = 0; x < SCREEN_WIDTH; ++x)
       screenData[y][x][0] = screenData[y][x][1] = screenData[y][x][2] = 0;
 
-  // Create a texture 
+  // Create a texture at hi-res size once, resolution switches only change
+  // the region uploaded and drawn
   // Level = none; border = none; format = RGB;
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, SCREEN_WIDTH);
   glTexImage2D(GL_TEXTURE_2D, 0, 3, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_RGB, GL_UNSIGNED_BYTE, (GLvoid*)screenData);
 
   // Set up the texture
@@ -164,23 +284,27 @@ void setupTexture(){
  */
 void updateTexture(struct chip8 *cpu){ 
   int x, y;
+  int width = screenWidth(cpu);
+  int height = screenHeight(cpu);
+  double right = (double)width / SCREEN_WIDTH;
+  double bottom = (double)height / SCREEN_HEIGHT;
 
   // Update pixels
-  for(y = 0; y < 32; ++y)   
-    for(x = 0; x < 64; ++x)
-      if(cpu->graphics[(y * 64) + x] == 0)
+  for(y = 0; y < height; ++y)   
+    for(x = 0; x < width; ++x)
+      if(pixelAt(cpu, x, y) == 0)
         screenData[y][x][0] = screenData[y][x][1] = screenData[y][x][2] = 0;  // Disabled
       else 
         screenData[y][x][0] = screenData[y][x][1] = screenData[y][x][2] = 255;  // Enabled
     
   // Update Texture
-  glTexSubImage2D(GL_TEXTURE_2D, 0 ,0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, GL_RGB, GL_UNSIGNED_BYTE, (GLvoid*)screenData);
+  glTexSubImage2D(GL_TEXTURE_2D, 0 ,0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, (GLvoid*)screenData);
 
   glBegin( GL_QUADS );
-    glTexCoord2d(0.0, 0.0);   glVertex2d(0.0, 0.0);
-    glTexCoord2d(1.0, 0.0);   glVertex2d(display_width, 0.0);
-    glTexCoord2d(1.0, 1.0);   glVertex2d(display_width, display_height);
-    glTexCoord2d(0.0, 1.0);   glVertex2d(0.0, display_height);
+    glTexCoord2d(0.0, 0.0);       glVertex2d(0.0, 0.0);
+    glTexCoord2d(right, 0.0);     glVertex2d(display_width, 0.0);
+    glTexCoord2d(right, bottom);  glVertex2d(display_width, display_height);
+    glTexCoord2d(0.0, bottom);    glVertex2d(0.0, display_height);
   glEnd();
 }
 
@@ -188,12 +312,12 @@ void updateTexture(struct chip8 *cpu){
  * Non-texture legacy routine
  * Draw vertices
  */
-void drawPixel(int x, int y){
+void drawPixel(int x, int y, int size){
   glBegin(GL_QUADS);
-    glVertex3f((x * MODIFIER) + 0.0f,     (y * MODIFIER) + 0.0f,   0.0f);
-    glVertex3f((x * MODIFIER) + 0.0f,     (y * MODIFIER) + MODIFIER, 0.0f);
-    glVertex3f((x * MODIFIER) + MODIFIER, (y * MODIFIER) + MODIFIER, 0.0f);
-    glVertex3f((x * MODIFIER) + MODIFIER, (y * MODIFIER) + 0.0f,   0.0f);
+    glVertex3f((x * size) + 0.0f, (y * size) + 0.0f, 0.0f);
+    glVertex3f((x * size) + 0.0f, (y * size) + size, 0.0f);
+    glVertex3f((x * size) + size, (y * size) + size, 0.0f);
+    glVertex3f((x * size) + size, (y * size) + 0.0f, 0.0f);
   glEnd();
 }
 
@@ -204,16 +328,18 @@ void drawPixel(int x, int y){
  */
 void updateQuads(struct chip8 *cpu){
   int x, y;
+  int width = screenWidth(cpu);
+  int size = MODIFIER * SCREEN_WIDTH / width;
   // Draw
-  for(y = 0; y < 32; ++y)   
-    for(x = 0; x < 64; ++x)
+  for(y = 0; y < screenHeight(cpu); ++y)   
+    for(x = 0; x < width; ++x)
     {
-      if(cpu->graphics[(y*64) + x] == 0) 
+      if(pixelAt(cpu, x, y) == 0) 
         glColor3f(0.0f,0.0f,0.0f); // draw white
       else 
         glColor3f(1.0f,1.0f,1.0f); // draw black
 
-      drawPixel(x, y);
+      drawPixel(x, y, size);
     }
 }
 
@@ -237,300 +363,120 @@ void reshape_window(GLsizei w, GLsizei h){
 
 /*
  * handles one instruction cycle
+ * One interpreter is generated per quirk profile, see emulate_cycle.h
  */
-void emulateCycle(struct chip8 *cpu){
-  int dont_increment = 0;
-  bool key_press = FALSE;
-  uint8_t x, y, n, pixel;
-  uint16_t opcode = (cpu->memory[cpu->program_counter] << 8 | 
-    cpu->memory[cpu->program_counter + 1]); // fetch opcode
-  cpu->opcode = opcode;
-
-  if (debug_enabled){
-    printf("Opcode: %04X\n", cpu->opcode);
-    dumpDebug(cpu);
-    printf("Press any key to continue");
-    getchar();
-  }
+#define EMULATE_CYCLE emulateCycleVip // COSMAC VIP
+#define QUIRK_SHIFT_VY 1
+#define QUIRK_LOAD_STORE 1
+#define QUIRK_CLIP 1
+#define QUIRK_INDEX_VF 0
+#define QUIRK_JUMP_VX 0
+#define QUIRK_LOGIC_VF 1
+#define QUIRK_SCHIP 0
+#include "emulate_cycle.h"
+
+#define EMULATE_CYCLE emulateCycleChip48 // CHIP-48 (HP-48)
+#define QUIRK_SHIFT_VY 0
+#define QUIRK_LOAD_STORE 2
+#define QUIRK_CLIP 1
+#define QUIRK_INDEX_VF 0
+#define QUIRK_JUMP_VX 1
+#define QUIRK_LOGIC_VF 0
+#define QUIRK_SCHIP 0
+#include "emulate_cycle.h"
+
+#define EMULATE_CYCLE emulateCycleSchip // SUPER-CHIP 1.1
+#define QUIRK_SHIFT_VY 0
+#define QUIRK_LOAD_STORE 0
+#define QUIRK_CLIP 1
+#define QUIRK_INDEX_VF 0
+#define QUIRK_JUMP_VX 1
+#define QUIRK_LOGIC_VF 0
+#define QUIRK_SCHIP 1
+#include "emulate_cycle.h"
+
+#define EMULATE_CYCLE emulateCycleModern // default: in-place shifts, FX55/FX65 advance I, wrapping sprites, FX1E overflow in VF, SUPER-CHIP
+#define QUIRK_SHIFT_VY 0
+#define QUIRK_LOAD_STORE 1
+#define QUIRK_CLIP 0
+#define QUIRK_INDEX_VF 1
+#define QUIRK_JUMP_VX 0
+#define QUIRK_LOGIC_VF 0
+#define QUIRK_SCHIP 1
+#include "emulate_cycle.h"
+
+struct quirk_profile {
+  const char *name;
+  void (*emulate)(struct chip8 *cpu);
+};
+
+struct quirk_profile quirk_profiles[] = {
+  { "vip",    emulateCycleVip },
+  { "chip48", emulateCycleChip48 },
+  { "schip",  emulateCycleSchip },
+  { "modern", emulateCycleModern },
+  { NULL,     NULL }
+};
+
+// interpreter for the selected profile, resolved once before the main loop
+void (*emulateCycle)(struct chip8 *cpu) = emulateCycleModern;
 
-  switch (opcode & 0xF000){ // Decode opcode
-    // Execute opcode
-    case 0x0000:
-      switch(opcode & 0x000F){
-        case  0x0000: // 0x00E0: clear screen
-          if (opcode != 0x00E0){
-            printf("Opcode not recognized: %04X\n", opcode);
-            dumpDebug(cpu);
-            exit(0);
-          }
-          memset(&cpu->graphics, 0, 64 * 32);
-          cpu->draw_flag = TRUE;
-          break;
-        case 0x000E: // 0x00EE: returns from subroutine
-          cpu->stack_pointer--;
-          cpu->program_counter = cpu->stack[cpu->stack_pointer];
-          break;
-        default:
-          printf("Opcode not recognized: %04X\n", opcode);
-          dumpDebug(cpu);
-          exit(0);
-      }
-      break;
-    case 0x1000: // 1NNN: jumps to address NNN
-      cpu->program_counter = (opcode & 0x0FFF);
-      dont_increment = 1;
-      break;
-    case 0x2000: // 2NNN: calls subroutine at address NNN
-      cpu->stack[cpu->stack_pointer] = cpu->program_counter;
-      cpu->stack_pointer++;
-      cpu->program_counter = (opcode & 0x0FFF);
-      dont_increment = 1;
-      break;
-    case 0x3000: // 3XNN: skips next instruction if VX == NN
-      if (cpu->registers[(opcode & 0x0F00) >> 8] == (opcode & 0x00FF))
-        cpu->program_counter += 2;
-      break;
-    case 0x4000: // 4XNN: skips next instruction if VX != NN
-      if (cpu->registers[(opcode & 0x0F00) >> 8] != (opcode & 0x00FF))
-        cpu->program_counter += 2;
-      break;
-    case 0x5000: // 5XY0: skips next instruction if VX == VY
-      if (cpu->registers[(opcode & 0x0F00) >> 8] == cpu->registers[(opcode & 0x00F0) >> 4])
-        cpu->program_counter += 2;
-      break;
-    case 0x6000: // 6XNN: sets VX to NN
-      cpu->registers[(opcode & 0x0F00) >> 8] = opcode & 0x00FF;
-      break;
-    case 0x7000: // 7XNN: Adds NN to VX
-      cpu->registers[(opcode & 0x0F00) >> 8] += opcode & 0x00FF;
-      break;
-    case 0x8000: // 8NNN: 
-      switch (opcode & 0x000F){
-        case 0x0000: // 8XY0: sets VX to VY
-          cpu->registers[(opcode & 0x0F00) >> 8] = cpu->registers[(opcode & 0x00F0) >> 4];
-          break;
-        case 0x0001: // 8XY1: sets VX to VX | VY
-          cpu->registers[(opcode & 0x0F00) >> 8] |= cpu->registers[(opcode & 0x00F0) >> 4];
-          break;
-        case 0x0002: // 8XY2: sets VX to VX & VY
-          cpu->registers[(opcode & 0x0F00) >> 8] &= cpu->registers[(opcode & 0x00F0) >> 4];
-          break;
-        case 0x0003: // 8XY3: sets VX to VX ^ VY
-          cpu->registers[(opcode & 0x0F00) >> 8] ^= cpu->registers[(opcode & 0x00F0) >> 4];
-          break;
-        case 0x0004: // 8XY4: adds VY to VX
-                     // VF is set to 1 when there's a carry, and to 0 when there isn't
-          if (cpu->registers[(opcode & 0x00F0) >> 4] > (0xFF - cpu->registers[(opcode & 0x0F00) >> 8]))
-            cpu->registers[0xF] = 1;
-          else
-            cpu->registers[0xF] = 0;
-          cpu->registers[(opcode & 0x0F00) >> 8] += cpu->registers[(opcode & 0x00F0) >> 4];
-          break;
-        case 0x0005: // 8XY5: subtracts VY from VX 
-                     // VF is set to 0 when there's a borrow, and 1 when there isn't.
-          if (cpu->registers[(opcode & 0x00F0) >> 4] > cpu->registers[(opcode & 0x0F00) >> 8])
-            cpu->registers[0xF] = 0;
-          else
-            cpu->registers[0xF] = 1;
-          cpu->registers[(opcode & 0x0F00) >> 8] -= cpu->registers[(opcode & 0x00F0) >> 4];
-          break;
-        case 0x0006: // 8XY6: VX >> 1
-                     // VF is set to the value of the least significant bit of VX before the shift
-          cpu->registers[0xF] = ((opcode & 0x0F00) >> 8) & 0x1;
-          cpu->registers[(opcode & 0x0F00) >> 8] >>= 1;
-          break;
-        case 0x0007: // 8XY7: Sets VX to VY minus VX
-                     // VF is set to 0 when there's a borrow, and 1 when there isn't
-          if (cpu->registers[(opcode & 0x00F0) >> 4] < cpu->registers[(opcode & 0x0F00) >> 8])
-            cpu->registers[0xF] = 0;
-          else
-            cpu->registers[0xF] = 1;
-          cpu->registers[(opcode & 0x0F00) >> 8] = cpu->registers[(opcode & 0x00F0) >> 4] - 
-            cpu->registers[(opcode & 0x0F00) >> 8];
-          break; 
-        case 0x000E: // 8XYE: VX << 1
-                     // VF is set to the value of the most significant bit of VX before the shift
-          cpu->registers[0xF] = cpu->registers[(opcode & 0x0F00) >> 8] >> 7;
-          cpu->registers[(opcode & 0x0F00) >> 8] <<= 1;
-          break;
-        default:
-          printf("Opcode not recognized: %04X\n", opcode);
-          dumpDebug(cpu);
-          exit(0);
-      }
-      break;
-    case 0x9000: // 9XY0: skips next instruction if VX != VY
-      if (cpu->registers[(opcode & 0x0F00) >> 8] != cpu->registers[(opcode & 0x00F0) >> 4])
-        cpu->program_counter += 2;
-      break;
-    case 0xA000: // ANNN: sets I to the address NNN
-      cpu->index = opcode & 0x0FFF;
-      break;
-    case 0xB000: // BNNN: jumps to address NNN plus V0
-      cpu->program_counter = (opcode & 0x0FFF) + cpu->registers[0];
-      dont_increment = 1;
-      break;
-    case 0xC000: // CXNN: VX = rand() & NN
-      cpu->registers[(opcode & 0x0F00) >> 8] = (rand() % 0xFF) & (opcode & 0x00FF);
-      break;
-    case 0xD000: // DXYN: Draws a sprite at coordinate (VX, VY) that has a width of 8 pixels and a 
-                 // height of N pixels. Each row of 8 pixels is read as bit-coded starting from memory 
-                 // location I; I value doesn’t change after the execution of this instruction. As 
-                 // described above, VF is set to 1 if any screen pixels are flipped from set to unset 
-                 // when the sprite is drawn, and to 0 if that doesn’t happen
-      x = cpu->registers[(opcode & 0x0F00) >> 8];
-      y = cpu->registers[(opcode & 0x00F0) >> 4];
-      n = opcode & 0x000F;
-      cpu->registers[0xF] = 0;
-      for (int height = 0; height < n; height++){
-        pixel = cpu->memory[cpu->index + height];
-        for (int width = 0; width < 8; width++){
-          if ((pixel & (0x80 >> width)) != 0){
-            if (cpu->graphics[(x + width + ((y + height) * 64))] == 1)
-              cpu->registers[0xF] = 1;
-            cpu->graphics[x + width + ((y + height) * 64)] ^= 1;
-          }
-        }
-      }
-      cpu->draw_flag = TRUE;
-      break;
-    case 0xE000: // ENNN: 
-      switch (opcode & 0x00FF){
-        case 0x009E: // EX9E: skips the next instruction if the key stored in VX is pressed
-          if (cpu->key[cpu->registers[(opcode & 0x0F00) >> 8]] != 0)
-            cpu->program_counter += 2;
-          break;
-        case 0x00A1: // EXA1: Skips the next instruction if the key stored in VX isn't pressed
-          if (cpu->key[cpu->registers[(opcode & 0x0F00) >> 8]] == 0)
-            cpu->program_counter += 2;
-          break;
-        default:
-          printf("Opcode not recognized: %04X\n", opcode);
-          dumpDebug(cpu);
-          exit(0);
-      }
-      break;
-    case 0xF000: // FNNN: 
-      switch (opcode & 0x00FF){
-        case 0x0007: // FX07: sets VX to the value of the delay timer
-          cpu->registers[(opcode & 0x0F00) >> 8] = cpu->delay_timer;
-          break;
-        case 0x000A: // FX0A: Wait for key, then store in VX
-          for (int i = 0; i < 16; i++){
-            if (cpu->key[i] != 0){
-              cpu->registers[(opcode & 0x0F00) >> 8] = cpu->index;
-              key_press = TRUE;
-            }
-            if (key_press == FALSE)
-              return;
-          }
-          break;
-        case 0x0015: // FX15: sets delay timer to VX
-          cpu->delay_timer = cpu->registers[(opcode & 0x0F00) >> 8];
-          break;
-        case 0x0018: // FX18: sets sound time to VX
-          cpu->sound_timer = cpu->registers[(opcode & 0x0F00) >> 8];
-          break;
-        case 0x001E: // FX1E: adds VX to index register
-                     // VF is set to 1 when range overflow (I+VX>0xFFF), otherwise 0
-          if ((cpu->index + cpu->registers[(opcode & 0x0F00) >> 8]) > 0xFFF)
-            cpu->registers[0xF] = 1;
-          else
-            cpu->registers[0xF] = 0;
-          cpu->index += cpu->registers[(opcode & 0x0F00) >> 8];
-          break;
-        case 0x0029: // FX29: sets index register to the location of the sprite for the character in 
-                     // VX. Characters 0-F (in hexadecimal) are represented by a 4x5 font
-          cpu->index = cpu->registers[(opcode & 0x0F00) >> 8] * 5;
-          break;
-        case 0x0033: // FX33: stores the binary-coded decimal representation of VX, with the most 
-                     // significant of three digits at the address in index register, the middle digit 
-                     // at index register plus 1, and the least significant digit at index register 
-                     // plus 2.
-          cpu->memory[cpu->index]     =  cpu->registers[(opcode & 0x0F00) >> 8] / 100;
-          cpu->memory[cpu->index + 1] = (cpu->registers[(opcode & 0x0F00) >> 8] / 10) % 10;
-          cpu->memory[cpu->index + 2] = (cpu->registers[(opcode & 0x0F00) >> 8] % 100) % 10;
-          break;
-        case 0x0055: // FX55: stores V0 to VX (including VX) in memory starting at address in index register
-          for (int i = 0; i <= ((opcode & 0x0F00) >> 8); i++)
-            cpu->memory[cpu->index + i] = cpu->registers[i];
-          cpu->index += ((opcode & 0x0F00) >> 8) + 1;
-          break;
-        case 0x0065: // FX65: fills V0 to VX (including VX) with values from memory starting at 
-                     // address in index register
-          for (int i = 0; i <= ((opcode & 0x0F00) >> 8); i++)
-            cpu->registers[i] = cpu->memory[cpu->index + i];
-          cpu->index += ((opcode & 0x0F00) >> 8) + 1;
-          break; 
-        default:
-          printf("Opcode not recognized: %04X\n", opcode);
-          dumpDebug(cpu);
-          exit(0);
-      }
-      break;
-    default:
-      printf("Opcode not recognized: %04X\n", opcode);
-      dumpDebug(cpu);
-      exit(0);
-  }
 
-  if (!dont_increment)
-    cpu->program_counter += 2;
+/*
+ * finds a quirk profile by name, NULL if unknown
+ */
+struct quirk_profile *findProfile(const char *name){
+  for (int i = 0; quirk_profiles[i].name != NULL; i++)
+    if (strcmp(quirk_profiles[i].name, name) == 0)
+      return &quirk_profiles[i];
+  return NULL;
+}
 
-  //updateTimers(cpu);
-  if(cpu->delay_timer > 0)
-    cpu->delay_timer--;
 
-  if(cpu->sound_timer > 0)
-  {
-    if(cpu->sound_timer == 1)
-      printf("BEEP!\n");
-    cpu->sound_timer--;
+/*
+ * FNV-1a hash of a program image, used as key in the ROM profile database
+ */
+uint64_t romHash(const uint8_t *rom, long size){
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  for (long i = 0; i < size; i++){
+    hash ^= rom[i];
+    hash *= 0x100000001B3ULL;
   }
+  return hash;
 }
 
 
-/*  
- * Resets chip8
+/*
+ * Looks up the profile for a ROM hash in a database file
+ * Each line holds a 16 digit hex hash and a profile name, '#' starts a comment
  */
-void coldBoot(struct chip8 *cpu){
-  uint8_t fontset[80] = { 
-    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-    0x20, 0x60, 0x20, 0x20, 0x70, // 1
-    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-  };
-
-  // reset chip
-  memset(cpu, 0, sizeof(struct chip8));
-  cpu->program_counter = 0x200;
-  cpu->delay_timer = 60;
-
-  // load fontset into memory
-  for (int i = 0; i < 80; i++)
-    cpu->memory[i] = fontset[i];
-
-  // set start time
-  gettimeofday(&cpu->clock_time, NULL);
-
-  c8 = cpu;
+struct quirk_profile *lookupProfile(const char *path, uint64_t hash){
+  FILE *db;
+  char line[256];
+  char name[64];
+  unsigned long long entry;
+  struct quirk_profile *profile = NULL;
+
+  db = fopen(path, "r");
+  if (db == NULL){
+    printf("ERROR: profile database failed to open\n");
+    return NULL;
+  }
+  while (profile == NULL && fgets(line, sizeof(line), db) != NULL){
+    if (line[0] == '#')
+      continue;
+    if (sscanf(line, "%llx %63s", &entry, name) == 2 && entry == hash)
+      profile = findProfile(name);
+  }
+  fclose(db);
+  return profile;
 }
 
 
 void display(){
   emulateCycle(c8);
+  if (c8->halted)
+    exit(0);
   
   if(c8->draw_flag){
     // Clear framebuffer
@@ -551,11 +497,171 @@ void display(){
 }
 
 
+/*
+ * Flushes the instruction trace on exit
+ */
+void closeTrace(){
+  traceClose(exit_trace);
+  exit_trace = NULL;
+}
+
+
+/*
+ * Runs cycles headless and returns the elapsed time in seconds
+ * cpu_time receives the CPU time of the emulating thread alone, which
+ * leaves out the trace writer even when it shares a core with the emulator.
+ */
+double timeCycles(struct chip8 *cpu, long cycles, double *cpu_time){
+  struct timeval start_time, end_time;
+  struct timespec start_cpu, end_cpu;
+
+  gettimeofday(&start_time, NULL);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start_cpu);
+  for (long i = 0; i < cycles && !cpu->halted; i++)
+    emulateCycle(cpu);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end_cpu);
+  gettimeofday(&end_time, NULL);
+
+  *cpu_time = (end_cpu.tv_sec - start_cpu.tv_sec) + (end_cpu.tv_nsec - start_cpu.tv_nsec) / 1e9;
+  return (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_usec - start_time.tv_usec) / 1e6;
+}
+
+
+/*
+ * Benchmarks the loaded program without a window
+ * Each run starts from a cold boot and the fastest of BENCH_RUNS is kept.
+ * With a trace attached traced runs alternate with untraced ones, starting
+ * traced so that a program that halts is still traced, the trace holding
+ * them back to back from a boot entry each, and the tracing overhead is
+ * reported.
+ */
+void benchmark(struct chip8 *cpu, long cycles){
+  struct chip8_image *image = cpu->image;
+  struct trace *trace = cpu->trace;
+  double plain = 0, traced = 0, plain_cpu = 0, traced_cpu = 0;
+  double elapsed, elapsed_cpu;
+  int traced_run;
+
+  atomic_fetch_add(&image->references, 1); // keep the image across reboots
+  for (int run = 0; run < BENCH_RUNS * 2; run++){
+    traced_run = !(run & 1); // alternate so that drift in machine speed hits both alike
+    if (traced_run && trace == NULL)
+      continue;
+    releaseMemory(cpu);
+    coldBoot(cpu, image);
+    cpu->trace = traced_run ? trace : NULL;
+    if (cpu->trace)
+      traceBoot(cpu->trace, cpu->registers);
+    elapsed = timeCycles(cpu, cycles, &elapsed_cpu);
+    if (cpu->halted){
+      printf("program halted at %04X within %ld cycles, nothing to benchmark\n", cpu->program_counter, cycles);
+      break;
+    }
+    if (!traced_run){
+      if (run <= 1 || elapsed < plain)
+        plain = elapsed;
+      if (run <= 1 || elapsed_cpu < plain_cpu)
+        plain_cpu = elapsed_cpu;
+    } else {
+      if (run == 0 || elapsed < traced)
+        traced = elapsed;
+      if (run == 0 || elapsed_cpu < traced_cpu)
+        traced_cpu = elapsed_cpu;
+    }
+  }
+
+  if (!cpu->halted)
+    printf("untraced: %ld cycles in %.3fs (%.0f cycles/s)\n", cycles, plain, cycles / plain);
+  if (trace != NULL && !cpu->halted){
+    printf("traced:   %ld cycles in %.3fs (%.0f cycles/s)\n", cycles, traced, cycles / traced);
+    printf("traced throughput: %.1f%% of untraced, tracing overhead %.1f%% (emulator thread alone %.1f%%)\n",
+      plain / traced * 100.0, (traced - plain) / plain * 100.0, (traced_cpu - plain_cpu) / plain_cpu * 100.0);
+  }
+  cpu->trace = trace;
+  releaseImage(image);
+}
+
+
+/*
+ * Explores every keypad input headless, breadth first
+ * Each level forks every machine once per choice of held key (or none) and
+ * runs it SEARCH_CYCLES instructions. Forks that reach a state already seen
+ * are pruned through the transposition table instead of being expanded again,
+ * forks that halt are dropped.
+ */
+void explore(struct chip8 *cpu, int depth){
+  struct transposition_table *table;
+  struct chip8 *level, *next, *swap;
+  struct timeval start_time, end_time;
+  long count = 1, next_count, pruned, halted, total_pruned = 0, total_halted = 0, total = 0;
+
+  table = transpositionCreate(SEARCH_TABLE_LOG2);
+  level = malloc(SEARCH_WIDTH * sizeof(struct chip8));
+  next = malloc(SEARCH_WIDTH * sizeof(struct chip8));
+  if (table == NULL || level == NULL || next == NULL){
+    printf("ERROR: out of memory for search\n");
+    transpositionFree(table);
+    free(level);
+    free(next);
+    return;
+  }
+
+  gettimeofday(&start_time, NULL);
+  cloneMachine(&level[0], cpu);
+  transpositionInsert(table, stateHash(&level[0]));
+  for (int d = 1; d <= depth && count > 0; d++){
+    next_count = 0;
+    pruned = 0;
+    halted = 0;
+    for (long m = 0; m < count; m++){
+      for (int input = 0; input <= 16 && next_count < SEARCH_WIDTH; input++){ // 16: no key held
+        struct chip8 *fork = &next[next_count];
+
+        cloneMachine(fork, &level[m]);
+        memset(fork->key, 0, sizeof(fork->key));
+        if (input < 16)
+          fork->key[input] = 1;
+        for (int i = 0; i < SEARCH_CYCLES && !fork->halted; i++)
+          emulateCycle(fork);
+        total++;
+        if (fork->halted){ // dead end, the program stopped
+          releaseMemory(fork);
+          halted++;
+        } else if (transpositionInsert(table, stateHash(fork))){
+          next_count++;
+        } else {
+          releaseMemory(fork);
+          pruned++;
+        }
+      }
+      releaseMemory(&level[m]);
+    }
+    printf("depth %d: %ld new states, %ld duplicates pruned, %ld halted\n", d, next_count, pruned, halted);
+    total_pruned += pruned;
+    total_halted += halted;
+    swap = level;
+    level = next;
+    next = swap;
+    count = next_count;
+  }
+  gettimeofday(&end_time, NULL);
+
+  for (long m = 0; m < count; m++)
+    releaseMemory(&level[m]);
+  printf("explored %ld states, pruned %ld (%.1f%%), %ld halted in %.3fs\n", total, total_pruned,
+    total > 0 ? total_pruned * 100.0 / total : 0.0, total_halted,
+    (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_usec - start_time.tv_usec) / 1e6);
+  free(level);
+  free(next);
+  transpositionFree(table);
+}
+
+
 /*
  * Loads practice addition program
  * Adds input nums and displays results
  */
-void loadGenericAddition(struct chip8 *cpu){
+void loadGenericAddition(struct chip8_image *image){
   uint8_t num1, num2;
   printf("Enter first integer: ");
   scanf("%hhu", &num1);
@@ -564,25 +670,26 @@ void loadGenericAddition(struct chip8 *cpu){
 
   // load program starting at 0x200
   // 1: 0x60NN: V0 = 1
-  cpu->memory[0x200] = 0x60;
-  cpu->memory[0x201] = num1;
+  image->memory[0x200] = 0x60;
+  image->memory[0x201] = num1;
   // 2: 0x61NN: V1 = 2
-  cpu->memory[0x202] = 0x61;
-  cpu->memory[0x203] = num2;
+  image->memory[0x202] = 0x61;
+  image->memory[0x203] = num2;
   // 3: 0x8014: V0 = V0 + V1
-  cpu->memory[0x204] = 0x80;
-  cpu->memory[0x205] = 0x14;
+  image->memory[0x204] = 0x80;
+  image->memory[0x205] = 0x14;
   // 4: 0xF029: load sprite for V0 into index
-  cpu->memory[0x206] = 0xF0;
-  cpu->memory[0x207] = 0x29;
+  image->memory[0x206] = 0xF0;
+  image->memory[0x207] = 0x29;
   // 5: 0xD005: draw sprite
-  cpu->memory[0x208] = 0xD0;
-  cpu->memory[0x209] = 0x05;
+  image->memory[0x208] = 0xD0;
+  image->memory[0x209] = 0x05;
 }
 
 
 int main(int argc, char *argv[]){
-  struct chip8 cpu1;
+  static struct chip8 cpu1; // outlives main for the atexit trace flush
+  struct chip8_image *image;
   FILE *program;
   unsigned int hex1, hex2 = 0;
   uint8_t half_opcode;
@@ -590,13 +697,20 @@ int main(int argc, char *argv[]){
   int opt;
   int program_arg = 1;
   int t_flag = 0;
-  long psize;
+  long psize = 0;
+  char *profile_name = NULL;
+  char *profile_db = NULL;
+  char *trace_path = NULL;
+  long bench_cycles = 0;
+  int search_depth = 0;
+  struct quirk_profile *profile = NULL;
+  uint64_t hash;
   char *buffer;
   size_t result;
 
   // process flags
   opterr = 0;
-  while ((opt = getopt(argc, argv, "dht")) != -1){
+  while ((opt = getopt(argc, argv, "dhtq:Q:T:b:S:")) != -1){
     program_arg++;
     switch (opt){
       case 'd': // debug
@@ -605,12 +719,36 @@ int main(int argc, char *argv[]){
       case 't': // text file
         t_flag = 1;
         break;
+      case 'q': // quirk profile
+        profile_name = optarg;
+        program_arg++;
+        break;
+      case 'Q': // ROM hash profile database
+        profile_db = optarg;
+        program_arg++;
+        break;
+      case 'T': // binary instruction trace
+        trace_path = optarg;
+        program_arg++;
+        break;
+      case 'b': // headless benchmark
+        bench_cycles = atol(optarg);
+        break;
+      case 'S': // headless input search
+        search_depth = atoi(optarg);
+        program_arg++;
+        break;
       case 'h': // help
         printf("USAGE: %s <program_name>\n", argv[0]);
-        printf("OPTIONS: -dh\n");
+        printf("OPTIONS: -dht -q <profile> -Q <database> -T <trace> -b <cycles> -S <depth>\n");
         printf("\t-d: debug mode\n");
         printf("\t-h: help\n");
         printf("\t-t: load text file\n");
+        printf("\t-q: quirk profile (vip, chip48, schip, modern)\n");
+        printf("\t-Q: ROM hash to quirk profile database\n");
+        printf("\t-T: write binary instruction trace\n");
+        printf("\t-b: run cycles without a window and report speed\n");
+        printf("\t-S: explore all key inputs to depth without a window, pruning repeated states\n");
         return 0;
       default:
         break;
@@ -622,7 +760,11 @@ int main(int argc, char *argv[]){
     return 0;  
   }
 
-  coldBoot(&cpu1); // setup chip8
+  image = createImage(); // font set, the program is copied in below
+  if (image == NULL){
+    printf("ERROR: out of memory\n");
+    return 0;
+  }
 
   if (t_flag){
     program = fopen(argv[argc - 1], "r");
@@ -658,9 +800,10 @@ int main(int argc, char *argv[]){
           return 0;
         }
 
-        cpu1.memory[start] = half_opcode; // store 
+        image->memory[start] = half_opcode; // store 
         start++;
       }
+      psize = start - 0x200;
       fclose(program);
     }
   } else {
@@ -693,7 +836,7 @@ int main(int argc, char *argv[]){
       // Copy buffer to Chip8 memory
       if((4096-512) > psize){
         for(int i = 0; i < psize; ++i)
-          cpu1.memory[i + 512] = buffer[i];
+          image->memory[i + 512] = buffer[i];
       } else {
         printf("Error: Program too large for memory [2]\n");
       }
@@ -703,8 +846,49 @@ int main(int argc, char *argv[]){
     fclose(program);
   }
 
+  // select quirk profile: -q wins over the database, modern is the default
+  hashImage(image);
+  coldBoot(&cpu1, image); // setup chip8
+  c8 = &cpu1;
+  releaseImage(image); // cpu1 holds the image from here on
+
+  hash = romHash(&image->memory[0x200], psize < 4096 - 0x200 ? psize : 4096 - 0x200);
+  if (profile_name != NULL){
+    profile = findProfile(profile_name);
+    if (profile == NULL){
+      printf("ERROR: unknown quirk profile %s\n", profile_name);
+      return 0;
+    }
+  } else if (profile_db != NULL){
+    profile = lookupProfile(profile_db, hash);
+  }
+  if (profile == NULL)
+    profile = findProfile("modern");
+  emulateCycle = profile->emulate;
+  if (debug_enabled)
+    printf("ROM hash: %016llX profile: %s\n", (unsigned long long)hash, profile->name);
+
+  if (trace_path != NULL){
+    cpu1.trace = traceOpen(trace_path, cpu1.registers);
+    if (cpu1.trace == NULL){
+      printf("ERROR: trace failed to open\n");
+      return 0;
+    }
+    exit_trace = cpu1.trace;
+    atexit(closeTrace);
+  }
+
   gettimeofday(&cpu1.clock_time, NULL); // reset time after reading in program
 
+  if (bench_cycles > 0){
+    benchmark(&cpu1, bench_cycles);
+    return 0;
+  }
+  if (search_depth > 0){
+    explore(&cpu1, search_depth);
+    return 0;
+  }
+
   glutInit(&argc, argv);     
   glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA);
 
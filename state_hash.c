@@ -0,0 +1,61 @@
+#include <stdlib.h>
+#include "state_hash.h"
+
+
+/*
+ * Creates an empty table with 2^log2_size slots, NULL on failure
+ */
+struct transposition_table *transpositionCreate(int log2_size){
+  struct transposition_table *table;
+
+  table = malloc(sizeof(struct transposition_table));
+  if (table == NULL)
+    return NULL;
+  table->slots = calloc((size_t)1 << log2_size, sizeof(uint64_t));
+  if (table->slots == NULL){
+    free(table);
+    return NULL;
+  }
+  table->mask = ((uint64_t)1 << log2_size) - 1;
+  return table;
+}
+
+
+/*
+ * Adds a state hash to the table
+ * Returns 1 when the state is new and 0 when it was already present, so the
+ * caller can prune duplicates. Lock free: empty slots are claimed with a
+ * compare and swap. When every probed slot holds another state the hash is
+ * reported as new rather than risk pruning a state that was never seen.
+ */
+int transpositionInsert(struct transposition_table *table, uint64_t hash){
+  uint64_t slot, expected;
+
+  if (hash == 0) // 0 marks an empty slot
+    hash = 1;
+
+  for (int probe = 0; probe < TRANSPOSITION_PROBES; probe++){
+    slot = (hash + probe) & table->mask;
+    expected = atomic_load_explicit(&table->slots[slot], memory_order_acquire);
+    if (expected == hash)
+      return 0;
+    if (expected == 0){
+      if (atomic_compare_exchange_strong(&table->slots[slot], &expected, hash))
+        return 1;
+      if (expected == hash) // another thread stored the same state
+        return 0;
+    }
+  }
+  return 1;
+}
+
+
+/*
+ * Releases a table
+ */
+void transpositionFree(struct transposition_table *table){
+  if (table == NULL)
+    return;
+  free(table->slots);
+  free(table);
+}
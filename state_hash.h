@@ -0,0 +1,52 @@
+#ifndef STATE_HASH_H
+#define STATE_HASH_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+// state components, combined with a slot and value into one hash key
+#define HASH_MEMORY 0x1
+#define HASH_GRAPHICS 0x2
+#define HASH_REGISTER 0x3
+#define HASH_INDEX 0x4
+#define HASH_PC 0x5
+#define HASH_STACK 0x6
+#define HASH_SP 0x7
+#define HASH_DELAY 0x8
+#define HASH_SOUND 0x9
+#define HASH_RPL 0xA
+#define HASH_HIRES 0xB
+
+#define TRANSPOSITION_PROBES 16 // slots tried before a state is treated as new
+
+
+/*
+ * Zobrist key for one component holding value at slot
+ * The key is mixed on the fly instead of read from a random table so that
+ * memory and graphics need no 64-bit entry per possible value. A zero value
+ * maps to key 0, which lets cleared state contribute nothing.
+ */
+static inline uint64_t hashKey(uint32_t kind, uint32_t slot, uint32_t value){
+  uint64_t key;
+
+  key = ((uint64_t)kind << 56) ^ ((uint64_t)slot << 32) ^ value;
+  key ^= 0x9E3779B97F4A7C15ULL;
+  key ^= key >> 33;
+  key *= 0xFF51AFD7ED558CCDULL;
+  key ^= key >> 33;
+  key *= 0xC4CEB9FE1A85EC53ULL;
+  key ^= key >> 33;
+  return key & -(uint64_t)(value != 0); // branch free, the hot loop calls this per write
+}
+
+// open addressing set of state hashes, safe to share between threads
+struct transposition_table {
+  _Atomic uint64_t *slots;
+  uint64_t mask;
+};
+
+struct transposition_table *transpositionCreate(int log2_size);
+int transpositionInsert(struct transposition_table *table, uint64_t hash);
+void transpositionFree(struct transposition_table *table);
+
+#endif
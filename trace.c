@@ -0,0 +1,209 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "trace.h"
+
+
+/*
+ * Serializes a record as little-endian bytes
+ */
+void traceEncode(const struct trace_record *record, uint8_t *out){
+  out[0] = record->cycle;
+  out[1] = record->cycle >> 8;
+  out[2] = record->cycle >> 16;
+  out[3] = record->cycle >> 24;
+  out[4] = record->program_counter;
+  out[5] = record->program_counter >> 8;
+  out[6] = record->opcode;
+  out[7] = record->opcode >> 8;
+  out[8] = record->index;
+  out[9] = record->index >> 8;
+  out[10] = record->mem_write;
+  out[11] = record->mem_write >> 8;
+  out[12] = record->changed;
+  out[13] = record->changed >> 8;
+  out[14] = record->value;
+  out[15] = record->vf;
+}
+
+
+/*
+ * Reads back a record written by traceEncode
+ */
+void traceDecode(const uint8_t *in, struct trace_record *record){
+  record->cycle = in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+  record->program_counter = in[4] | (in[5] << 8);
+  record->opcode = in[6] | (in[7] << 8);
+  record->index = in[8] | (in[9] << 8);
+  record->mem_write = in[10] | (in[11] << 8);
+  record->changed = in[12] | (in[13] << 8);
+  record->value = in[14];
+  record->vf = in[15];
+}
+
+
+/*
+ * Advances the cycle field of an encoded record by one
+ */
+static void predictCycle(uint8_t *previous){
+  uint32_t cycle;
+
+  cycle = (previous[0] | (previous[1] << 8) | (previous[2] << 16) | ((uint32_t)previous[3] << 24)) + 1;
+  previous[0] = cycle;
+  previous[1] = cycle >> 8;
+  previous[2] = cycle >> 16;
+  previous[3] = cycle >> 24;
+}
+
+
+/*
+ * Mask of the bytes that differ between two 8-byte words, bit n for byte n
+ */
+static inline uint32_t wordDiff(const uint8_t *a, const uint8_t *b){
+  uint64_t x, y;
+
+  memcpy(&x, a, 8);
+  memcpy(&y, b, 8);
+  x ^= y;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  x = __builtin_bswap64(x);
+#endif
+  x = (((x & 0x7F7F7F7F7F7F7F7FULL) + 0x7F7F7F7F7F7F7F7FULL) | x) & 0x8080808080808080ULL; // top bit per nonzero byte
+  return ((x >> 7) * 0x0102040810204080ULL) >> 56;
+}
+
+
+/*
+ * Mask of the bytes that differ between two 16-byte blocks
+ */
+static inline uint16_t blockDiff(const uint8_t *a, const uint8_t *b){
+  return wordDiff(a, b) | (wordDiff(a + 8, b + 8) << 8);
+}
+
+
+/*
+ * Delta compresses an encoded record against the previous one
+ * Writes a 16-bit little-endian mask of the bytes that differ from the
+ * prediction (previous record, cycle + 1) followed by those bytes, and
+ * updates previous. Returns the number of bytes written to out.
+ */
+int traceCompress(const uint8_t *encoded, uint8_t *previous, uint8_t *out){
+  uint16_t mask, bits;
+  int size = 2;
+
+  predictCycle(previous);
+  mask = blockDiff(encoded, previous);
+  for (bits = mask; bits != 0; bits &= bits - 1)
+    out[size++] = encoded[__builtin_ctz(bits)];
+  memcpy(previous, encoded, TRACE_RECORD_SIZE);
+  out[0] = mask;
+  out[1] = mask >> 8;
+  return size;
+}
+
+
+/*
+ * Reads and decompresses the next record written by traceCompress
+ * previous must start zeroed with the cycle field set to 0xFFFFFFFF.
+ * Returns 0 at end of file.
+ */
+int traceRead(FILE *file, uint8_t *previous, struct trace_record *record){
+  uint8_t buffer[TRACE_RECORD_SIZE + 2];
+  uint16_t mask;
+  int size = 0;
+
+  if (fread(buffer, 1, 2, file) != 2)
+    return 0;
+  mask = buffer[0] | (buffer[1] << 8);
+  for (int i = 0; i < TRACE_RECORD_SIZE; i++)
+    if (mask & (1 << i))
+      size++;
+  if (fread(buffer + 2, 1, size, file) != size)
+    return 0;
+
+  predictCycle(previous);
+  size = 2;
+  for (int i = 0; i < TRACE_RECORD_SIZE; i++)
+    if (mask & (1 << i))
+      previous[i] = buffer[size++];
+  traceDecode(previous, record);
+  return 1;
+}
+
+
+/*
+ * Writer thread
+ * Appends the ring to the trace file as raw entries, sleeping briefly when
+ * it is empty. Slots are handed back only once written.
+ */
+static void *traceWriter(void *arg){
+  struct trace *trace = arg;
+  struct timespec idle = { 0, 1000000 }; // 1ms
+  uint32_t head, tail, count;
+  int stop;
+
+  while (1){
+    stop = atomic_load(&trace->stop); // before head, so everything pushed ahead of stop is drained
+    head = atomic_load_explicit(&trace->head, memory_order_acquire);
+    tail = atomic_load_explicit(&trace->tail, memory_order_relaxed);
+    if (head == tail){
+      if (stop)
+        break;
+      nanosleep(&idle, NULL);
+      continue;
+    }
+
+    // one contiguous run of slots, up to the end of the ring
+    count = head - tail;
+    if (count > TRACE_BATCH)
+      count = TRACE_BATCH;
+    if (count > TRACE_RING_SIZE - (tail & (TRACE_RING_SIZE - 1)))
+      count = TRACE_RING_SIZE - (tail & (TRACE_RING_SIZE - 1));
+    fwrite(&trace->ring[tail & (TRACE_RING_SIZE - 1)], sizeof(struct trace_entry), count, trace->file);
+    atomic_store_explicit(&trace->tail, tail + count, memory_order_release);
+  }
+  return NULL;
+}
+
+
+/*
+ * Creates a raw trace file and starts its writer thread, NULL on failure
+ * registers holds V0-VF of the machine as tracing starts.
+ */
+struct trace *traceOpen(const char *path, const uint8_t *registers){
+  struct trace *trace;
+  uint8_t header[8] = { 'C', '8', 'T', 'R', TRACE_VERSION, TRACE_RAW, sizeof(struct trace_entry), 0 };
+
+  trace = calloc(1, sizeof(struct trace));
+  if (trace == NULL)
+    return NULL;
+
+  trace->file = fopen(path, "wb");
+  if (trace->file == NULL){
+    free(trace);
+    return NULL;
+  }
+  fwrite(header, 1, sizeof(header), trace->file);
+  traceBoot(trace, registers);
+
+  if (pthread_create(&trace->writer, NULL, traceWriter, trace) != 0){
+    fclose(trace->file);
+    free(trace);
+    return NULL;
+  }
+  return trace;
+}
+
+
+/*
+ * Flushes outstanding records, stops the writer and closes the file
+ */
+void traceClose(struct trace *trace){
+  if (trace == NULL)
+    return;
+  atomic_store(&trace->stop, 1);
+  pthread_join(trace->writer, NULL);
+  fclose(trace->file);
+  free(trace);
+}
@@ -0,0 +1,119 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define TRACE_MAGIC "C8TR"
+#define TRACE_VERSION 3
+#define TRACE_RAW 0               // header format byte: trace_entry array as the emulator wrote it
+#define TRACE_PACKED 1            // header format byte: delta compressed records, see traceCompress
+#define TRACE_RECORD_SIZE 16     // bytes per record before delta compression
+#define TRACE_RING_SIZE (1 << 16) // entries, must be a power of two
+#define TRACE_BATCH 4096          // most entries per write
+#define TRACE_NO_WRITE 0xFFFF
+#define TRACE_BOOT 0xFFFF         // program_counter of an entry giving the registers a run starts from
+
+// one executed instruction
+struct trace_record {
+  uint32_t cycle;
+  uint16_t program_counter; // address the opcode was fetched from
+  uint16_t opcode;
+  uint16_t index;           // index register after the instruction
+  uint16_t mem_write;       // first address stored to, TRACE_NO_WRITE if none
+  uint16_t changed;         // bit n set when Vn changed
+  uint8_t value;            // lowest changed register after the instruction, 0 if none
+  uint8_t vf;               // VF after the instruction
+};
+
+// raw instruction state as the emulator queues it and raw traces store it, in
+// host byte order. chip8trace derives the records.
+struct trace_entry {
+  uint16_t program_counter;
+  uint16_t opcode;
+  uint16_t index;
+  uint16_t mem_write;
+  uint8_t registers[16];    // V0-VF after the instruction
+};
+
+// per machine trace, single producer (emulator) and single consumer (writer thread)
+struct trace {
+  struct trace_entry ring[TRACE_RING_SIZE];
+  _Atomic uint32_t head; // next slot the emulator fills
+  _Atomic uint32_t tail; // next slot the writer drains
+  uint32_t cached_tail;  // emulator's last view of tail
+  atomic_int stop;
+  pthread_t writer;
+  FILE *file;
+};
+
+struct trace *traceOpen(const char *path, const uint8_t *registers);
+void traceClose(struct trace *trace);
+void traceEncode(const struct trace_record *record, uint8_t *out);
+void traceDecode(const uint8_t *in, struct trace_record *record);
+int traceCompress(const uint8_t *encoded, uint8_t *previous, uint8_t *out);
+int traceRead(FILE *file, uint8_t *previous, struct trace_record *record);
+
+
+/*
+ * Claims the next ring slot
+ * Blocks (yielding) only when the writer falls a full ring behind.
+ */
+static inline struct trace_entry *traceSlot(struct trace *trace){
+  uint32_t head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+
+  if (head - trace->cached_tail == TRACE_RING_SIZE){
+    while ((trace->cached_tail = atomic_load_explicit(&trace->tail, memory_order_acquire)) ==
+        head - TRACE_RING_SIZE)
+      sched_yield();
+  }
+  return &trace->ring[head & (TRACE_RING_SIZE - 1)];
+}
+
+
+/*
+ * Hands the slot from traceSlot to the writer
+ */
+static inline void tracePush(struct trace *trace){
+  atomic_store_explicit(&trace->head, atomic_load_explicit(&trace->head, memory_order_relaxed) + 1,
+    memory_order_release);
+}
+
+
+/*
+ * Records one instruction
+ * Only copies the instruction state into the ring, the writer stores it as
+ * is and chip8trace works out the cycle and changed registers.
+ */
+static inline void traceInstruction(struct trace *trace, uint16_t program_counter, uint16_t opcode,
+    const uint8_t *registers, uint16_t index, uint16_t mem_write){
+  struct trace_entry *entry = traceSlot(trace);
+
+  entry->program_counter = program_counter;
+  entry->opcode = opcode;
+  entry->index = index;
+  entry->mem_write = mem_write;
+  memcpy(entry->registers, registers, 16);
+  tracePush(trace);
+}
+
+
+/*
+ * Marks the start of a run from registers
+ * Cycles count from 0 again and changed registers of the next instruction
+ * are worked out against these.
+ */
+static inline void traceBoot(struct trace *trace, const uint8_t *registers){
+  struct trace_entry *entry = traceSlot(trace);
+
+  memset(entry, 0, sizeof(struct trace_entry));
+  entry->program_counter = TRACE_BOOT;
+  memcpy(entry->registers, registers, 16);
+  tracePush(trace);
+}
+
+#endif
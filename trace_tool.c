@@ -0,0 +1,338 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "trace.h"
+
+// record filter, fields set to -1 match everything
+struct filter {
+  long program_counter;
+  long opcode;
+  long opcode_mask;
+  long mem_write;
+  long reg;
+  long first_cycle;
+  long last_cycle;
+};
+
+
+/*
+ * Prints usage
+ */
+void usage(char *name){
+  printf("USAGE: %s dump <trace> [-p pc] [-o opcode] [-m mask] [-w address] [-r register] "
+    "[-c first:last]\n", name);
+  printf("       %s diff <trace> <trace>\n", name);
+  printf("       %s pack <trace> <packed trace>\n", name);
+  printf("\t-p: only instructions fetched from pc\n");
+  printf("\t-o: only opcodes equal to opcode after applying mask (default mask FFFF)\n");
+  printf("\t-w: only instructions storing to memory starting at address\n");
+  printf("\t-r: only instructions changing register\n");
+  printf("\t-c: only cycles in range\n");
+  printf("pack delta compresses a raw trace as written by chip8 -T\n");
+}
+
+
+// open trace file and its decoding state
+struct trace_file {
+  FILE *file;
+  int format;                          // TRACE_RAW or TRACE_PACKED
+  uint8_t previous[TRACE_RECORD_SIZE]; // packed: last record
+  uint8_t registers[16];               // raw: V0-VF before the next entry
+  uint32_t cycle;                      // raw: cycle of the next entry
+};
+
+
+/*
+ * Opens a trace and checks its header, returns 0 on failure
+ */
+int openTrace(const char *path, struct trace_file *trace){
+  FILE *file;
+  uint8_t header[8];
+
+  file = fopen(path, "rb");
+  if (file == NULL){
+    printf("ERROR: trace %s failed to open\n", path);
+    return 0;
+  }
+  if (fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, TRACE_MAGIC, 4) != 0 ||
+      header[4] != TRACE_VERSION ||
+      !((header[5] == TRACE_RAW && header[6] == sizeof(struct trace_entry)) ||
+        (header[5] == TRACE_PACKED && header[6] == TRACE_RECORD_SIZE))){
+    printf("ERROR: %s is not a version %d trace\n", path, TRACE_VERSION);
+    fclose(file);
+    return 0;
+  }
+
+  trace->file = file;
+  trace->format = header[5];
+  memset(trace->previous, 0, sizeof(trace->previous));
+  memset(trace->previous, 0xFF, 4); // first record is cycle 0
+  memset(trace->registers, 0, sizeof(trace->registers));
+  trace->cycle = 0;
+  return 1;
+}
+
+
+/*
+ * Builds a record from a raw entry
+ * Changed registers are those that differ from the previous entry or boot.
+ */
+void deriveRecord(struct trace_file *trace, const struct trace_entry *entry, struct trace_record *record){
+  record->cycle = trace->cycle++;
+  record->program_counter = entry->program_counter;
+  record->opcode = entry->opcode;
+  record->index = entry->index;
+  record->mem_write = entry->mem_write;
+  record->changed = 0;
+  record->value = 0;
+  for (int i = 15; i >= 0; i--){
+    if (entry->registers[i] != trace->registers[i]){
+      record->changed |= 1 << i;
+      record->value = entry->registers[i];
+    }
+  }
+  record->vf = entry->registers[0xF];
+  memcpy(trace->registers, entry->registers, 16);
+}
+
+
+/*
+ * Reads the next record, returns 0 at end of trace
+ */
+int readRecord(struct trace_file *trace, struct trace_record *record){
+  struct trace_entry entry;
+
+  if (trace->format == TRACE_PACKED)
+    return traceRead(trace->file, trace->previous, record);
+
+  while (fread(&entry, sizeof(entry), 1, trace->file) == 1){
+    if (entry.program_counter == TRACE_BOOT){ // new run, cycles count from 0 again
+      memcpy(trace->registers, entry.registers, 16);
+      trace->cycle = 0;
+      continue;
+    }
+    deriveRecord(trace, &entry, record);
+    return 1;
+  }
+  return 0;
+}
+
+
+/*
+ * Prints one record
+ */
+void printRecord(const char *prefix, const struct trace_record *record){
+  int changed = __builtin_popcount(record->changed);
+
+  printf("%s%10u  PC %04X  %04X  I %04X", prefix, record->cycle, record->program_counter,
+    record->opcode, record->index);
+  if (changed > 0)
+    printf("  V%X=%02X", __builtin_ctz(record->changed), record->value);
+  else
+    printf("       ");
+  if (changed > 1)
+    printf(" (+%d)", changed - 1);
+  else
+    printf("     ");
+  printf("  changed %04X", record->changed);
+  printf("  VF %02X", record->vf);
+  if (record->mem_write != TRACE_NO_WRITE)
+    printf("  [%04X]", record->mem_write);
+  printf("\n");
+}
+
+
+/*
+ * Checks a record against the filter
+ */
+int matches(const struct filter *filter, const struct trace_record *record){
+  if (filter->program_counter >= 0 && record->program_counter != filter->program_counter)
+    return 0;
+  if (filter->opcode >= 0 && (record->opcode & filter->opcode_mask) != filter->opcode)
+    return 0;
+  if (filter->mem_write >= 0 && record->mem_write != filter->mem_write)
+    return 0;
+  if (filter->reg >= 0 && !(record->changed & (1 << filter->reg)))
+    return 0;
+  if (filter->first_cycle >= 0 && record->cycle < filter->first_cycle)
+    return 0;
+  if (filter->last_cycle >= 0 && record->cycle > filter->last_cycle)
+    return 0;
+  return 1;
+}
+
+
+/*
+ * Prints the records of a trace that pass the filter
+ */
+int dump(const char *path, const struct filter *filter){
+  struct trace_file trace;
+  struct trace_record record;
+  long total = 0, shown = 0;
+
+  if (!openTrace(path, &trace))
+    return 1;
+  while (readRecord(&trace, &record)){
+    total++;
+    if (matches(filter, &record)){
+      printRecord("", &record);
+      shown++;
+    }
+  }
+  fclose(trace.file);
+  printf("%ld of %ld records\n", shown, total);
+  return 0;
+}
+
+
+/*
+ * Compares two traces record by record and reports the first divergence
+ * Returns 0 when the traces are identical
+ */
+int diff(const char *path_a, const char *path_b){
+  struct trace_file trace_a, trace_b;
+  struct trace_record a, b, previous;
+  int more_a, more_b;
+  long count = 0;
+  int status = 0;
+
+  if (!openTrace(path_a, &trace_a))
+    return 2;
+  if (!openTrace(path_b, &trace_b)){
+    fclose(trace_a.file);
+    return 2;
+  }
+
+  while (1){
+    more_a = readRecord(&trace_a, &a);
+    more_b = readRecord(&trace_b, &b);
+    if (!more_a || !more_b){
+      if (more_a != more_b){
+        printf("traces diverge in length after %ld records: %s ends first\n", count,
+          more_a ? path_b : path_a);
+        status = 1;
+      }
+      break;
+    }
+    if (memcmp(&a, &b, sizeof(struct trace_record)) != 0){
+      printf("traces diverge at record %ld\n", count);
+      if (count > 0)
+        printRecord("  ", &previous);
+      printRecord("< ", &a);
+      printRecord("> ", &b);
+      status = 1;
+      break;
+    }
+    previous = a;
+    count++;
+  }
+
+  if (status == 0)
+    printf("traces identical (%ld records)\n", count);
+  fclose(trace_a.file);
+  fclose(trace_b.file);
+  return status;
+}
+
+
+/*
+ * Writes a trace in packed form
+ */
+int pack(const char *path, const char *out_path){
+  struct trace_file trace;
+  struct trace_record record;
+  uint8_t header[8] = { 'C', '8', 'T', 'R', TRACE_VERSION, TRACE_PACKED, TRACE_RECORD_SIZE, 0 };
+  uint8_t previous[TRACE_RECORD_SIZE] = { 0xFF, 0xFF, 0xFF, 0xFF };
+  uint8_t encoded[TRACE_RECORD_SIZE];
+  uint8_t packed[TRACE_RECORD_SIZE + 2];
+  FILE *out;
+  long count = 0, size = sizeof(header);
+
+  if (!openTrace(path, &trace))
+    return 1;
+  out = fopen(out_path, "wb");
+  if (out == NULL){
+    printf("ERROR: %s failed to open\n", out_path);
+    fclose(trace.file);
+    return 1;
+  }
+
+  fwrite(header, 1, sizeof(header), out);
+  while (readRecord(&trace, &record)){
+    traceEncode(&record, encoded);
+    size += fwrite(packed, 1, traceCompress(encoded, previous, packed), out);
+    count++;
+  }
+  fclose(trace.file);
+  fclose(out);
+  printf("%ld records, %ld bytes (%.1f per record)\n", count, size, count > 0 ? (double)size / count : 0.0);
+  return 0;
+}
+
+
+int main(int argc, char *argv[]){
+  struct filter filter = { -1, -1, 0xFFFF, -1, -1, -1, -1 };
+  int opt;
+
+  if (argc < 3){
+    usage(argv[0]);
+    return 2;
+  }
+
+  if (strcmp(argv[1], "diff") == 0){
+    if (argc != 4){
+      usage(argv[0]);
+      return 2;
+    }
+    return diff(argv[2], argv[3]);
+  }
+
+  if (strcmp(argv[1], "pack") == 0){
+    if (argc != 4){
+      usage(argv[0]);
+      return 2;
+    }
+    return pack(argv[2], argv[3]);
+  }
+
+  if (strcmp(argv[1], "dump") != 0){
+    usage(argv[0]);
+    return 2;
+  }
+
+  // process flags after the trace name
+  optind = 3;
+  while ((opt = getopt(argc, argv, "p:o:m:w:r:c:")) != -1){
+    switch (opt){
+      case 'p':
+        filter.program_counter = strtol(optarg, NULL, 16);
+        break;
+      case 'o':
+        filter.opcode = strtol(optarg, NULL, 16);
+        break;
+      case 'm':
+        filter.opcode_mask = strtol(optarg, NULL, 16);
+        break;
+      case 'w':
+        filter.mem_write = strtol(optarg, NULL, 16);
+        break;
+      case 'r':
+        filter.reg = strtol(optarg, NULL, 16);
+        break;
+      case 'c':
+        if (sscanf(optarg, "%ld:%ld", &filter.first_cycle, &filter.last_cycle) != 2){
+          usage(argv[0]);
+          return 2;
+        }
+        break;
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+  if (filter.opcode >= 0)
+    filter.opcode &= filter.opcode_mask;
+  return dump(argv[2], &filter);
+}